@@ -0,0 +1,151 @@
+#include "cwe_io.h"
+
+#include <iomanip>
+#include <string>
+
+using CWE::Command;
+using CWE::CommandPool;
+using CWE::IOBackendType;
+using CWE::IOCommand;
+using CWE::IOService;
+
+// File throughput benchmark, from many small reads to large sequential streams.
+// usage: io_benchmark [file size in MiB] [streams]
+
+static std::atomic<uint64_t> bytesRead(0);
+static std::atomic<uint64_t> operations(0);
+
+// Reads its blocks with blocking pread calls, tying up the worker.
+class BlockingReadCommand : public Command<BlockingReadCommand> {
+ public:
+  BlockingReadCommand(int fd, uint32_t block, uintmax_t blocks, uintmax_t minsize)
+      : Command(0, blocks, minsize), fd(fd), block(block) {}
+
+ protected:
+  void execute() {
+    std::vector<char> buffer(block);
+
+    for (auto i = start; i < end; i++) {
+      ssize_t result = pread(fd, buffer.data(), block, (off_t) (i * block));
+      if (result > 0) {
+        bytesRead += (uint64_t) result;
+      }
+      operations++;
+    }
+  }
+
+  int fd;
+  uint32_t block;
+};
+
+// Streams [offset, end) through a pooled buffer, each completion submitting the next read.
+class StreamCommand : public IOCommand<StreamCommand> {
+ public:
+  StreamCommand(IOService<> *io, int fd, uint32_t block, uint64_t offset, uint64_t end, bool continuation = false)
+      : io(io), fd(fd), block(block), offset(offset), end(end), continuation(continuation) {}
+
+ protected:
+  void execute() {
+    int32_t index = request.bufferIndex;
+
+    if (!continuation) {
+      index = io->acquireBuffer();
+    } else if (request.result > 0) {
+      bytesRead += (uint64_t) request.result;
+      operations++;
+      offset += (uint64_t) request.result;
+    } else {
+      offset = end;
+    }
+
+    if (offset >= end) {
+      io->releaseBuffer(index);
+      return;
+    }
+
+    auto length = (uint32_t) (std::min)((uint64_t) block, end - offset);
+    io->readFixed(fd, index, length, offset, new StreamCommand(io, fd, block, offset, end, true));
+  }
+
+  IOService<> *io;
+  int fd;
+  uint32_t block;
+  uint64_t offset;
+  uint64_t end;
+  bool continuation;
+};
+
+static void report(const std::string &name, uint32_t block, std::chrono::steady_clock::duration elapsed) {
+  double seconds = std::chrono::duration<double>(elapsed).count();
+
+  std::cout << std::left << std::setw(12) << name
+            << std::right << std::setw(10) << block
+            << std::setw(14) << std::fixed << std::setprecision(1) << bytesRead.load() / seconds / (1024 * 1024)
+            << std::setw(14) << std::setprecision(0) << operations.load() / seconds << std::endl;
+
+  bytesRead = 0;
+  operations = 0;
+}
+
+static void blocking(int fd, uint64_t size, uint32_t block) {
+  CommandPool<> pool;
+  uintmax_t blocks = size / block;
+
+  auto begin = std::chrono::steady_clock::now();
+  pool.addCommand(new BlockingReadCommand(fd, block, blocks, (std::max)(blocks / 64, (uintmax_t) 1)));
+  pool.waitUntilDone();
+
+  report("blocking", block, std::chrono::steady_clock::now() - begin);
+}
+
+static void streamed(const std::string &name, IOBackendType type, int fd, uint64_t size, uint32_t block,
+                     uint32_t streams) {
+  CommandPool<> pool;
+  IOService<> io(pool, streams, streams, block, type);
+
+  if (io.backendType() != type) {
+    std::cout << std::left << std::setw(12) << name << " unavailable" << std::endl;
+    return;
+  }
+
+  uint64_t slice = size / streams;
+  auto begin = std::chrono::steady_clock::now();
+  for (uint32_t a = 0; a < streams; a++) {
+    pool.addCommand(new StreamCommand(&io, fd, block, a * slice, (a + 1 == streams) ? size : (a + 1) * slice));
+  }
+  pool.waitUntilDone();
+
+  report(name, block, std::chrono::steady_clock::now() - begin);
+}
+
+int main(int argc, char **argv) {
+  uint64_t size = (uint64_t) ((argc > 1) ? std::stoul(argv[1]) : 64) * 1024 * 1024;
+  uint32_t streams = (argc > 2) ? (uint32_t) std::stoul(argv[2]) : 32;
+  const uint32_t blocks[] = {4096, 65536, 1024 * 1024};
+
+  std::string path("/tmp/cwe_io_benchmark_XXXXXX");
+  int fd = mkstemp(&path[0]);
+  std::vector<char> chunk(1024 * 1024, 'c');
+  for (uint64_t offset = 0; offset < size; offset += chunk.size()) {
+    if (pwrite(fd, chunk.data(), chunk.size(), (off_t) offset) < 0) {
+      std::cerr << "unable to write " << path << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << std::left << std::setw(12) << "backend"
+            << std::right << std::setw(10) << "block"
+            << std::setw(14) << "MiB/s"
+            << std::setw(14) << "reads/s" << std::endl;
+
+  for (auto block : blocks) {
+    blocking(fd, size, block);
+    streamed("threads", IOBackendType::threads, fd, size, block, streams);
+    streamed("io_uring", IOBackendType::uring, fd, size, block, streams);
+  }
+
+  close(fd);
+  unlink(path.c_str());
+
+  return 0;
+}
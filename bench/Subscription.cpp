@@ -0,0 +1,83 @@
+#include "cwe.h"
+
+#include <iomanip>
+#include <string>
+
+using CWE::MaskSubscription;
+using CWE::NonAtomic;
+using CWE::Subscription;
+
+// Routing benchmark, per check cost of accepts() and of group updates for each subscription type.
+// usage: subscription_benchmark [iterations]
+
+typedef Subscription<std::bitset<255>, unsigned char> BitsetSubscription;
+typedef MaskSubscription<255, unsigned char, NonAtomic> WordSubscription;
+typedef MaskSubscription<255, unsigned char, std::atomic> AtomicWordSubscription;
+
+static void report(const std::string &name, const std::string &operation, uint64_t count, uint64_t checksum,
+                   std::chrono::steady_clock::duration elapsed) {
+  double nanoseconds = std::chrono::duration<double, std::nano>(elapsed).count();
+
+  std::cout << std::left << std::setw(12) << name
+            << std::setw(14) << operation
+            << std::right << std::setw(12) << std::fixed << std::setprecision(2) << nanoseconds / count
+            << std::setw(12) << checksum << std::endl;
+}
+
+template<typename subscription>
+static void run(const std::string &name, uint64_t iterations) {
+  const uint8_t workers = 16;
+  const uint8_t commands = 64;
+  std::default_random_engine generator;
+  std::uniform_int_distribution<unsigned int> group(0, 254);
+
+  // Workers subscribe to many groups, commands require one or two of them, or none.
+  std::vector<subscription> workerSubscriptions(workers);
+  std::vector<subscription> commandSubscriptions(commands);
+  for (auto &worker : workerSubscriptions) {
+    for (uint8_t a = 0; a < 64; a++) {
+      worker.subscribeToGroup((unsigned char) group(generator));
+    }
+  }
+  for (uint8_t a = 0; a < commands; a++) {
+    for (uint8_t b = 0; b < a % 3; b++) {
+      commandSubscriptions[a].subscribeToGroup((unsigned char) group(generator));
+    }
+  }
+
+  uint64_t accepted = 0;
+  auto begin = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < iterations; i++) {
+    // Every check reads another command, so its mask loads cannot be hoisted out of the worker loop.
+    for (uint8_t w = 0; w < workers; w++) {
+      accepted += workerSubscriptions[w].accepts(commandSubscriptions[(i + w) % commands]);
+    }
+  }
+  report(name, "accepts", iterations * workers, accepted, std::chrono::steady_clock::now() - begin);
+
+  subscription updated;
+  subscription empty;
+  begin = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < iterations; i++) {
+    auto g = (unsigned char) (i % 255);
+    updated.subscribeToGroup(g);
+    updated.unSubscribeFromGroup((unsigned char) ((g * 7) % 255));
+  }
+  report(name, "group update", iterations * 2, updated.accepts(empty),
+         std::chrono::steady_clock::now() - begin);
+}
+
+int main(int argc, char **argv) {
+  uint64_t iterations = (argc > 1) ? std::stoull(argv[1]) : 1000000;
+
+  std::cout << std::left << std::setw(12) << "type"
+            << std::setw(14) << "operation"
+            << std::right << std::setw(12) << "ns/op"
+            << std::setw(12) << "checksum" << std::endl;
+
+  run<BitsetSubscription>("bitset", iterations);
+  run<WordSubscription>("word", iterations);
+  run<AtomicWordSubscription>("atomic word", iterations);
+
+  return 0;
+}
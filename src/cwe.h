@@ -12,6 +12,7 @@
 #include <math.h>
 #include <random>
 #include <memory>
+#include <atomic>
 
 #include "../external/MPMCQueue/MPMCQueue.h"
 
@@ -96,22 +97,148 @@ class Subscription {
   }
 
   void unSubscribe(const type &otherMask) {
-    for (std::size_t a = 0; a < sizeof(type) * 8; a++) {
-      if (otherMask & (1 << a)) {
-        if ((mask & (1 << a))) {
-          mask &= ~(1 << a);
-        }
-      }
-    }
+    mask &= ~otherMask;
   }
 
  protected:
   type mask;
 };
 
+// Atom policy with the std::atomic interface for values only touched by one thread at a time.
+template<typename T>
+class NonAtomic {
+ public:
+  T load(std::memory_order = std::memory_order_seq_cst) const {
+    return value;
+  }
+
+  void store(T other, std::memory_order = std::memory_order_seq_cst) {
+    value = other;
+  }
+
+  T fetch_or(T other, std::memory_order = std::memory_order_seq_cst) {
+    T previous = value;
+    value |= other;
+    return previous;
+  }
+
+  T fetch_and(T other, std::memory_order = std::memory_order_seq_cst) {
+    T previous = value;
+    value &= other;
+    return previous;
+  }
+
+ private:
+  T value;
+};
+
+// Word packed subscription, every operation touches whole 64 bit words instead of single bits.
+// With std::atomic words, group updates are lock free and worker subscriptions can change while commands
+// are routed. NonAtomic words leave the word loops to the compiler's vectorizer.
+template<std::size_t bits, typename numeric_type, template<typename> class Atom = std::atomic>
+class MaskSubscription {
+  static const std::size_t words = (bits + 63) / 64;
+
+ public:
+  MaskSubscription() {
+    for (std::size_t a = 0; a < words; a++) {
+      mask[a].store(0, std::memory_order_relaxed);
+    }
+  };
+
+  MaskSubscription(uint64_t lowMask) : MaskSubscription() {
+    mask[0].store(lowMask, std::memory_order_relaxed);
+  };
+
+  MaskSubscription(const std::bitset<bits> &bitMask) : MaskSubscription() {
+    const std::bitset<bits> word((std::numeric_limits<uint64_t>::max)());
+
+    for (std::size_t a = 0; a < words; a++) {
+      mask[a].store((uint64_t) ((bitMask >> (a * 64)) & word).to_ullong(), std::memory_order_relaxed);
+    }
+  };
+
+  MaskSubscription(const MaskSubscription &other) {
+    for (std::size_t a = 0; a < words; a++) {
+      mask[a].store(other.mask[a].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+  }
+
+  MaskSubscription &operator=(const MaskSubscription &other) {
+    for (std::size_t a = 0; a < words; a++) {
+      mask[a].store(other.mask[a].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    return *this;
+  }
+
+  bool accepts(const MaskSubscription &subscription) const {
+    return accepts<Atom>(subscription);
+  }
+
+  // Workers with atomic words can check commands carrying plain words.
+  template<template<typename> class OtherAtom>
+  bool accepts(const MaskSubscription<bits, numeric_type, OtherAtom> &subscription) const {
+    uint64_t missing = 0;
+    uint64_t required = 0;
+    uint64_t available = 0;
+
+    for (std::size_t a = 0; a < words; a++) {
+      uint64_t other = subscription.mask[a].load(std::memory_order_relaxed);
+      uint64_t own = mask[a].load(std::memory_order_relaxed);
+
+      missing |= other & ~own;
+      required |= other;
+      available |= own;
+    }
+
+    // A command without groups only goes to workers without groups.
+    return (required == 0) ? (available == 0) : (missing == 0);
+  }
+
+  void subscribeToGroup(numeric_type group) {
+    assert((std::size_t) group < bits);
+    mask[group / 64].fetch_or((uint64_t) 1 << (group % 64), std::memory_order_relaxed);
+  }
+
+  // Lock free per word, not across words.
+  void subscribe(const MaskSubscription &otherMask) {
+    for (std::size_t a = 0; a < words; a++) {
+      mask[a].fetch_or(otherMask.mask[a].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+  }
+
+  void unSubscribeFromGroup(numeric_type group) {
+    assert((std::size_t) group < bits);
+    mask[group / 64].fetch_and(~((uint64_t) 1 << (group % 64)), std::memory_order_relaxed);
+  }
+
+  // Lock free per word, not across words.
+  void unSubscribe(const MaskSubscription &otherMask) {
+    for (std::size_t a = 0; a < words; a++) {
+      mask[a].fetch_and(~otherMask.mask[a].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+  }
+
+ protected:
+  template<std::size_t, typename, template<typename> class> friend class MaskSubscription;
+
+  Atom<uint64_t> mask[words];
+};
+
 typedef unsigned char subscription_numeric_type;
+// Mask type accepted by default_subscription, kept from when it wrapped a bitset.
 typedef std::bitset<uint8_t_max> subscription_type;
-typedef Subscription<subscription_type, subscription_numeric_type> default_subscription;
+typedef MaskSubscription<uint8_t_max, subscription_numeric_type, NonAtomic> default_subscription;
+typedef MaskSubscription<uint8_t_max, subscription_numeric_type, std::atomic> atomic_subscription;
+
+// Poller interface, driven by idle workers (e.g. reaping I/O completions).
+class PollerInterface {
+ public:
+  virtual ~PollerInterface() {};
+  // Returns true when progress was made.
+  virtual bool poll() = 0;
+};
 
 // CommandPoolInterface
 template<typename T>
@@ -123,6 +250,22 @@ class CommandPoolInterface {
   virtual bool isDone() = 0;
 };
 
+// Interface for pools whose idle workers drive a poller, for work running outside of their queues.
+template<typename T>
+class PollingCommandPoolInterface : public virtual CommandPoolInterface<T> {
+ public:
+  virtual ~PollingCommandPoolInterface() {};
+  // Registers a poller driven by idle workers, fails when every poller slot is taken.
+  virtual bool addPoller(PollerInterface *poller) = 0;
+  // Unregisters a poller and waits for the polls running it.
+  virtual void removePoller(PollerInterface *poller) = 0;
+  // Keeps the pool busy for work running outside of its queues (e.g. in flight I/O).
+  virtual void retain() = 0;
+  virtual void release() = 0;
+  // Whether addCommand would currently find a worker for the command.
+  virtual bool accepts(T command) = 0;
+};
+
 // Command
 template<class subscription = default_subscription>
 class BaseCommand : public subscription {
@@ -269,9 +412,10 @@ template<
     class Partitioner = CommandPartitioner,
     template<typename> class Atom = std::atomic,
     template<typename> class QueueAdapter = MPMCQueueAdapter,
-    class subscription = default_subscription
+    class subscription = default_subscription,
+    class worker_subscription = subscription
 >
-class CommandPool : public virtual CommandPoolInterface<BaseCommand<subscription> *> {
+class CommandPool : public virtual PollingCommandPoolInterface<BaseCommand<subscription> *> {
   static_assert(
       std::is_base_of<CommandPartitioner, Partitioner>::value,
       "CommandPartitioner is not a base class of given Partitioner"
@@ -284,11 +428,20 @@ class CommandPool : public virtual CommandPoolInterface<BaseCommand<subscription
   );
 
  public:
-  CommandPool() : numOfThreads(n), work(0), runningThreads(0), partitioner() {
+  CommandPool() : numOfThreads(n), work(0), runningThreads(0), pollers(0), partitioner() {
     if (numOfThreads == 0) {
       numOfThreads = static_cast<uint8_t>(hardware_concurrency);
     }
 
+    for (uint8_t a = 0; a < max_pollers; a++) {
+      poller[a].store(nullptr);
+    }
+
+    polling.reset(new PollingFlag[numOfThreads]);
+    for (uint8_t a = 0; a < numOfThreads; a++) {
+      polling[a].active.store(0);
+    }
+
     stop.resize(numOfThreads);
     subscriptions.resize(numOfThreads);
 
@@ -362,6 +515,57 @@ class CommandPool : public virtual CommandPoolInterface<BaseCommand<subscription
     return true;
   }
 
+  // Workers only receive commands their subscription accepts. Changing it while commands are added
+  // requires a worker_subscription with atomic words (e.g. atomic_subscription), commands can keep plain ones.
+  worker_subscription &workerSubscription(uint8_t thread) {
+    return subscriptions[thread];
+  }
+
+  bool addPoller(PollerInterface *newPoller) {
+    for (uint8_t a = 0; a < max_pollers; a++) {
+      PollerInterface *expected = nullptr;
+      if (poller[a].compare_exchange_strong(expected, newPoller)) {
+        pollers++;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void removePoller(PollerInterface *oldPoller) {
+    for (uint8_t a = 0; a < max_pollers; a++) {
+      PollerInterface *expected = oldPoller;
+      if (poller[a].compare_exchange_strong(expected, nullptr)) {
+        pollers--;
+
+        for (uint8_t b = 0; b < numOfThreads; b++) {
+          while (polling[b].active.load() != 0) {
+          }
+        }
+        return;
+      }
+    }
+  }
+
+  void retain() {
+    work++;
+  }
+
+  bool accepts(BaseCommand<subscription> *command) {
+    for (auto &it : subscriptions) {
+      if (it.accepts(*command)) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void release() {
+    work--;
+  }
+
  private:
   int consume(uint8_t a) {
     runningThreads++;
@@ -369,6 +573,9 @@ class CommandPool : public virtual CommandPoolInterface<BaseCommand<subscription
       BaseCommand<subscription> *item;
 
       if (!queue[a]->tryPop(item)) {
+        if (poll(a)) {
+          continue;
+        }
         if (getThreadId() != main_thread_id) {
           continue;
         }
@@ -383,6 +590,27 @@ class CommandPool : public virtual CommandPoolInterface<BaseCommand<subscription
     return 0;
   }
 
+  bool poll(uint8_t a) {
+    // Pools without pollers stay off the polling flags.
+    if (pollers.load(std::memory_order_relaxed) == 0) {
+      return false;
+    }
+
+    bool progress = false;
+
+    // Raised before reading the slots, so removePoller sees every poll that may still use its poller.
+    polling[a].active.store(1);
+    for (uint8_t b = 0; b < max_pollers; b++) {
+      PollerInterface *current = poller[b].load();
+      if (current != nullptr) {
+        progress |= current->poll();
+      }
+    }
+    polling[a].active.store(0);
+
+    return progress;
+  }
+
   bool isDone() {
     return work.load() == 0;
   }
@@ -390,13 +618,24 @@ class CommandPool : public virtual CommandPoolInterface<BaseCommand<subscription
   CommandPool(const CommandPool &other) = delete;
   CommandPool &operator=(const CommandPool &) = delete;
 
+  // Each worker flags its polls on its own cache line, so idle workers do not contend with each other.
+  struct alignas(64) PollingFlag {
+    Atom<uint8_t> active;
+  };
+
+  static const uint8_t max_pollers = 4;
+
   uint8_t numOfThreads;
   Atom<uint32_t> work;
   Atom<uint8_t> runningThreads;
+  // Kept off the cache line of work, which every command completion writes.
+  alignas(64) Atom<uint8_t> pollers;
+  Atom<PollerInterface *> poller[max_pollers];
+  std::unique_ptr<PollingFlag[]> polling;
   std::vector<std::thread *> threads;
   std::vector<uint8_t> stop;
   std::vector<std::unique_ptr<QueueAdapterInterface<BaseCommand<subscription> *>>> queue;
-  std::vector<subscription> subscriptions;
+  std::vector<worker_subscription> subscriptions;
   Partitioner partitioner;
 };
 }
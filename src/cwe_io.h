@@ -0,0 +1,590 @@
+#ifndef CWE_IO_H
+#define CWE_IO_H
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "cwe.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+// IORING_OP_READ and IORING_OP_WRITE came with the 5.6 headers, as did IORING_FEAT_RW_CUR_POS.
+#if defined(IORING_FEAT_RW_CUR_POS) && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) \
+    && defined(__NR_io_uring_register)
+#define CWE_HAS_IO_URING
+#endif
+#endif
+#endif
+
+namespace CWE {
+
+// IOOperation
+enum class IOOperation : uint8_t {
+  read,
+  write
+};
+
+// IOBackendType
+enum class IOBackendType : uint8_t {
+  automatic,
+  uring,
+  threads
+};
+
+// IORequest
+struct IORequest {
+  IORequest()
+      : operation(IOOperation::read), fd(-1), buffer(nullptr), length(0), offset(0), bufferIndex(-1), result(0),
+        owner(nullptr) {};
+
+  IOOperation operation;
+  int fd;
+  char *buffer;
+  uint32_t length;
+  uint64_t offset;
+  // Pooled buffer index, -1 for caller provided buffers.
+  int32_t bufferIndex;
+  // Bytes transferred, or -errno on failure.
+  int32_t result;
+  // Set while the request is in flight, cleared before the continuation is scheduled.
+  void *owner;
+};
+
+// IO backend interface
+class IOBackendInterface {
+ public:
+  virtual ~IOBackendInterface() {};
+  // Queues a request, the kernel or I/O threads only see it after a flush.
+  virtual void submit(IORequest *request) = 0;
+  // Hands all queued requests over in a single batch, returns the number of requests flushed.
+  virtual uint32_t flush() = 0;
+  // Collects finished requests without blocking, returns the number of requests collected.
+  virtual uint32_t reap(IORequest **requests, uint32_t max) = 0;
+  virtual bool registerBuffers(const struct iovec *buffers, uint32_t count) = 0;
+  virtual IOBackendType type() = 0;
+};
+
+// IO backend running blocking pread/pwrite calls on dedicated threads.
+class ThreadIOBackend : public virtual IOBackendInterface {
+ public:
+  explicit ThreadIOBackend(uint32_t depth, uint32_t batch = 1, uint8_t numOfThreads = 4)
+      : batch(batch), unsubmitted(0), stop(false), completed(depth) {
+    for (uint8_t a = 0; a < numOfThreads; a++) {
+      threads.emplace_back(&ThreadIOBackend::run, this);
+    }
+  }
+
+  virtual ~ThreadIOBackend() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    condition.notify_all();
+
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  }
+
+  void submit(IORequest *request) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      requests.push_back(request);
+    }
+
+    if (++unsubmitted >= batch) {
+      flush();
+    }
+  }
+
+  uint32_t flush() {
+    if (unsubmitted.load(std::memory_order_relaxed) == 0) {
+      return 0;
+    }
+
+    uint32_t count = unsubmitted.exchange(0);
+    if (count != 0) {
+      condition.notify_all();
+    }
+
+    return count;
+  }
+
+  uint32_t reap(IORequest **requests, uint32_t max) {
+    uint32_t count = 0;
+    while (count < max && completed.try_pop(requests[count])) {
+      count++;
+    }
+
+    return count;
+  }
+
+  bool registerBuffers(const struct iovec *, uint32_t) {
+    return true;
+  }
+
+  IOBackendType type() {
+    return IOBackendType::threads;
+  }
+
+ private:
+  void run() {
+    while (true) {
+      IORequest *request;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this] { return stop || !requests.empty(); });
+
+        if (requests.empty()) {
+          return;
+        }
+
+        request = requests.front();
+        requests.pop_front();
+      }
+
+      ssize_t result;
+      if (request->operation == IOOperation::read) {
+        result = pread(request->fd, request->buffer, request->length, (off_t) request->offset);
+      } else {
+        result = pwrite(request->fd, request->buffer, request->length, (off_t) request->offset);
+      }
+      request->result = (result < 0) ? -errno : (int32_t) result;
+
+      completed.push(request);
+    }
+  }
+
+  ThreadIOBackend(const ThreadIOBackend &other) = delete;
+  ThreadIOBackend &operator=(const ThreadIOBackend &) = delete;
+
+  uint32_t batch;
+  std::atomic<uint32_t> unsubmitted;
+  bool stop;
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::deque<IORequest *> requests;
+  rigtorp::MPMCQueue<IORequest *> completed;
+  std::vector<std::thread> threads;
+};
+
+#ifdef CWE_HAS_IO_URING
+
+// IO backend for linux io_uring, talking to the rings directly through the raw system calls.
+class IOUringBackend : public virtual IOBackendInterface {
+ public:
+  explicit IOUringBackend(uint32_t depth, uint32_t batch = 1)
+      : batch(batch), unsubmitted(0), fixed(false), ring(-1), sqRing(nullptr), cqRing(nullptr), sqes(nullptr),
+        sqRingSize(0), cqRingSize(0), sqesSize(0) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring = (int) syscall(__NR_io_uring_setup, depth, &params);
+    if (ring < 0) {
+      return;
+    }
+
+    // Kernels before 5.6 set up rings but reject IORING_OP_READ and IORING_OP_WRITE.
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+      release();
+      return;
+    }
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      sqRingSize = cqRingSize = (std::max)(sqRingSize, cqRingSize);
+    }
+
+    sqRing = map(sqRingSize, IORING_OFF_SQ_RING);
+    cqRing = (params.features & IORING_FEAT_SINGLE_MMAP) ? sqRing : map(cqRingSize, IORING_OFF_CQ_RING);
+    sqes = static_cast<struct io_uring_sqe *>(map(sqesSize, IORING_OFF_SQES));
+
+    if (sqRing == nullptr || cqRing == nullptr || sqes == nullptr) {
+      release();
+      return;
+    }
+
+    char *sq = static_cast<char *>(sqRing);
+    sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+    char *cq = static_cast<char *>(cqRing);
+    cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+  }
+
+  virtual ~IOUringBackend() {
+    release();
+  }
+
+  bool isReady() {
+    return ring >= 0;
+  }
+
+  void submit(IORequest *request) {
+    {
+      std::lock_guard<std::mutex> lock(sqMutex);
+      unsigned tail = *sqTail;
+      unsigned index = tail & sqMask;
+      struct io_uring_sqe *sqe = &sqes[index];
+
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->fd = request->fd;
+      sqe->addr = (uint64_t) (uintptr_t) request->buffer;
+      sqe->len = request->length;
+      sqe->off = request->offset;
+      sqe->user_data = (uint64_t) (uintptr_t) request;
+
+      if (fixed && request->bufferIndex >= 0) {
+        sqe->opcode = (request->operation == IOOperation::read) ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+        sqe->buf_index = (uint16_t) request->bufferIndex;
+      } else {
+        sqe->opcode = (request->operation == IOOperation::read) ? IORING_OP_READ : IORING_OP_WRITE;
+      }
+
+      sqArray[index] = index;
+      __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    if (++unsubmitted >= batch) {
+      flush();
+    }
+  }
+
+  uint32_t flush() {
+    if (unsubmitted.load(std::memory_order_relaxed) == 0) {
+      return 0;
+    }
+
+    uint32_t count = unsubmitted.exchange(0);
+    if (count == 0) {
+      return 0;
+    }
+
+    int submitted = (int) syscall(__NR_io_uring_enter, ring, count, 0, 0, nullptr, 0);
+    if (submitted < 0) {
+      submitted = 0;
+    }
+    if ((uint32_t) submitted < count) {
+      unsubmitted += count - (uint32_t) submitted;
+    }
+
+    return (uint32_t) submitted;
+  }
+
+  uint32_t reap(IORequest **requests, uint32_t max) {
+    // Idle workers find an empty ring without touching the lock.
+    if (__atomic_load_n(cqHead, __ATOMIC_RELAXED) == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+      return 0;
+    }
+
+    std::unique_lock<std::mutex> lock(cqMutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+      return 0;
+    }
+
+    uint32_t count = 0;
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+
+    while (head != tail && count < max) {
+      struct io_uring_cqe *cqe = &cqes[head & cqMask];
+      IORequest *request = reinterpret_cast<IORequest *>((uintptr_t) cqe->user_data);
+      request->result = cqe->res;
+      requests[count++] = request;
+      head++;
+    }
+
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+    return count;
+  }
+
+  bool registerBuffers(const struct iovec *buffers, uint32_t count) {
+    fixed = syscall(__NR_io_uring_register, ring, IORING_REGISTER_BUFFERS, buffers, count) == 0;
+
+    return fixed;
+  }
+
+  IOBackendType type() {
+    return IOBackendType::uring;
+  }
+
+ private:
+  void *map(size_t size, off_t offset) {
+    void *address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, offset);
+
+    return (address == MAP_FAILED) ? nullptr : address;
+  }
+
+  void release() {
+    if (sqes != nullptr) {
+      munmap(sqes, sqesSize);
+    }
+    if (cqRing != nullptr && cqRing != sqRing) {
+      munmap(cqRing, cqRingSize);
+    }
+    if (sqRing != nullptr) {
+      munmap(sqRing, sqRingSize);
+    }
+    if (ring >= 0) {
+      close(ring);
+    }
+
+    sqes = nullptr;
+    cqRing = sqRing = nullptr;
+    ring = -1;
+  }
+
+  IOUringBackend(const IOUringBackend &other) = delete;
+  IOUringBackend &operator=(const IOUringBackend &) = delete;
+
+  uint32_t batch;
+  std::atomic<uint32_t> unsubmitted;
+  bool fixed;
+  int ring;
+  void *sqRing;
+  void *cqRing;
+  struct io_uring_sqe *sqes;
+  size_t sqRingSize;
+  size_t cqRingSize;
+  size_t sqesSize;
+  unsigned *sqHead;
+  unsigned *sqTail;
+  unsigned sqMask;
+  unsigned *sqArray;
+  unsigned *cqHead;
+  unsigned *cqTail;
+  unsigned cqMask;
+  struct io_uring_cqe *cqes;
+  std::mutex sqMutex;
+  std::mutex cqMutex;
+};
+
+#endif // CWE_HAS_IO_URING
+
+// Command scheduled on the pool once its I/O request completed.
+template<class subscription = default_subscription>
+class BaseIOCommand : public BaseCommand<subscription> {
+ public:
+  using BaseCommand<subscription>::BaseCommand;
+
+  IORequest request;
+};
+
+// Template for a copy construction cloneable I/O command
+template<typename Derived, class subscription = default_subscription>
+class IOCommand : public BaseIOCommand<subscription> {
+ public:
+  using BaseIOCommand<subscription>::BaseIOCommand;
+
+  BaseCommand<subscription> *clone() const override {
+    return new Derived(static_cast<Derived const &>(*this));
+  }
+};
+
+// IOService, submits reads and writes and schedules their continuation commands on the pool.
+// Completions are reaped by idle pool workers. Call waitUntilDone() on the pool before destroying the service,
+// which must happen before the pool is destroyed.
+template<class subscription = default_subscription>
+class IOService : public virtual PollerInterface {
+ public:
+  explicit IOService(PollingCommandPoolInterface<BaseCommand<subscription> *> &pool,
+                     uint32_t depth = 256,
+                     uint32_t bufferCount = 0,
+                     uint32_t bufferSize = 0,
+                     IOBackendType type = IOBackendType::automatic)
+      : pool(pool), depth(depth), inFlight(0), buffers(nullptr, &free), bufferCount(bufferCount),
+        bufferSize(bufferSize) {
+    uint32_t batch = (std::max)(depth / 8, (uint32_t) 1);
+
+#ifdef CWE_HAS_IO_URING
+    if (type != IOBackendType::threads) {
+      std::unique_ptr<IOUringBackend> uring(new IOUringBackend(depth, batch));
+      if (uring->isReady()) {
+        backend = std::move(uring);
+      }
+    }
+#endif
+
+    if (!backend) {
+      backend.reset(new ThreadIOBackend(depth, batch));
+    }
+
+    if (bufferCount != 0 && bufferSize != 0) {
+      void *memory = nullptr;
+      if (posix_memalign(&memory, 4096, (size_t) bufferCount * bufferSize) == 0) {
+        buffers.reset(static_cast<char *>(memory));
+        freeBuffers.reset(new rigtorp::MPMCQueue<int32_t>(bufferCount));
+
+        std::vector<struct iovec> iovecs(bufferCount);
+        for (uint32_t a = 0; a < bufferCount; a++) {
+          iovecs[a].iov_base = buffer((int32_t) a);
+          iovecs[a].iov_len = bufferSize;
+          freeBuffers->push((int32_t) a);
+        }
+
+        // Unregistered buffers still work, the backend then falls back to plain reads and writes.
+        backend->registerBuffers(iovecs.data(), bufferCount);
+      }
+    }
+
+    bool registered = pool.addPoller(this);
+    assert(registered);
+    (void) registered;
+  }
+
+  // Requests still in flight are drained without scheduling their continuations, which could call back
+  // into the destroyed service.
+  virtual ~IOService() {
+    pool.removePoller(this);
+
+    while (inFlight.load() != 0) {
+      complete(false);
+    }
+  }
+
+  // Fails when the service is saturated, the continuation is a range or no worker accepts it. The caller then
+  // keeps its ownership.
+  bool read(int fd, char *buffer, uint32_t length, uint64_t offset, BaseIOCommand<subscription> *continuation) {
+    return submit(IOOperation::read, fd, buffer, -1, length, offset, continuation);
+  }
+
+  bool write(int fd, const char *buffer, uint32_t length, uint64_t offset,
+             BaseIOCommand<subscription> *continuation) {
+    return submit(IOOperation::write, fd, const_cast<char *>(buffer), -1, length, offset, continuation);
+  }
+
+  bool readFixed(int fd, int32_t bufferIndex, uint32_t length, uint64_t offset,
+                 BaseIOCommand<subscription> *continuation) {
+    assert(bufferIndex >= 0 && (uint32_t) bufferIndex < bufferCount && length <= bufferSize);
+    return submit(IOOperation::read, fd, buffer(bufferIndex), bufferIndex, length, offset, continuation);
+  }
+
+  bool writeFixed(int fd, int32_t bufferIndex, uint32_t length, uint64_t offset,
+                  BaseIOCommand<subscription> *continuation) {
+    assert(bufferIndex >= 0 && (uint32_t) bufferIndex < bufferCount && length <= bufferSize);
+    return submit(IOOperation::write, fd, buffer(bufferIndex), bufferIndex, length, offset, continuation);
+  }
+
+  // Returns a pooled buffer index, or -1 when none is available.
+  int32_t acquireBuffer() {
+    int32_t index = -1;
+    if (freeBuffers) {
+      freeBuffers->try_pop(index);
+    }
+
+    return index;
+  }
+
+  void releaseBuffer(int32_t index) {
+    assert(index >= 0 && (uint32_t) index < bufferCount);
+    freeBuffers->push(index);
+  }
+
+  char *buffer(int32_t index) {
+    return buffers.get() + (size_t) index * bufferSize;
+  }
+
+  uint32_t getBufferSize() {
+    return bufferSize;
+  }
+
+  uint32_t pending() {
+    return inFlight.load();
+  }
+
+  IOBackendType backendType() {
+    return backend->type();
+  }
+
+  bool poll() {
+    return complete(true);
+  }
+
+ private:
+  bool complete(bool schedule) {
+    IORequest *completed[32];
+    uint32_t flushed = backend->flush();
+    uint32_t count = backend->reap(completed, 32);
+
+    for (uint32_t a = 0; a < count; a++) {
+      auto *command = static_cast<BaseIOCommand<subscription> *>(completed[a]->owner);
+      command->request.owner = nullptr;
+
+      // Dropped continuations (worker subscriptions changed since the submit) still give their buffer back.
+      if (!schedule || !pool.addCommand(command)) {
+        if (command->request.bufferIndex >= 0) {
+          releaseBuffer(command->request.bufferIndex);
+        }
+        delete command;
+      }
+      inFlight--;
+      pool.release();
+    }
+
+    return flushed != 0 || count != 0;
+  }
+
+  bool submit(IOOperation operation, int fd, char *buffer, int32_t bufferIndex, uint32_t length, uint64_t offset,
+              BaseIOCommand<subscription> *continuation) {
+    // Range continuations would be partitioned into clones sharing one request and its buffer.
+    if (continuation->isRange() || !pool.accepts(continuation)) {
+      return false;
+    }
+
+    if (inFlight.fetch_add(1) >= depth) {
+      inFlight--;
+      return false;
+    }
+
+    pool.retain();
+
+    IORequest &request = continuation->request;
+    request.operation = operation;
+    request.fd = fd;
+    request.buffer = buffer;
+    request.bufferIndex = bufferIndex;
+    request.length = length;
+    request.offset = offset;
+    request.result = 0;
+    request.owner = continuation;
+
+    backend->submit(&request);
+
+    return true;
+  }
+
+  IOService(const IOService &other) = delete;
+  IOService &operator=(const IOService &) = delete;
+
+  PollingCommandPoolInterface<BaseCommand<subscription> *> &pool;
+  uint32_t depth;
+  std::atomic<uint32_t> inFlight;
+  std::unique_ptr<IOBackendInterface> backend;
+  std::unique_ptr<char, decltype(&free)> buffers;
+  std::unique_ptr<rigtorp::MPMCQueue<int32_t>> freeBuffers;
+  uint32_t bufferCount;
+  uint32_t bufferSize;
+};
+}
+#endif // CWE_IO_H
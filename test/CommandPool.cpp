@@ -104,4 +104,53 @@ TEST(CommandPool, addCommand_notAccepted) {
   pool.waitUntilDone();
   EXPECT_EQ(Counter::counter.load(), (uint32_t) 0);
   Counter::reset();
-}
\ No newline at end of file
+}
+
+TEST(CommandPool, workerSubscription) {
+  CommandPool<> pool;
+  pool.workerSubscription(0).subscribeToGroup(1);
+
+  BaseCommand<> *command = new CountCommand();
+  command->subscribeToGroup(1);
+  EXPECT_EQ(pool.addCommand(command), true);
+  pool.waitUntilDone();
+  EXPECT_EQ(Counter::counter.load(), (uint32_t) 1);
+  Counter::reset();
+
+  pool.workerSubscription(0).unSubscribeFromGroup(1);
+  command = new CountCommand();
+  command->subscribeToGroup(1);
+  EXPECT_EQ(pool.addCommand(command), false);
+  Counter::reset();
+}
+TEST(CommandPool, workerSubscription_concurrent) {
+  // Commands keep plain words, the workers' atomic words change while commands are routed.
+  CommandPool<2, true, false, CWE::CommandPartitioner, std::atomic, CWE::MPMCQueueAdapter, CWE::default_subscription,
+              CWE::atomic_subscription> pool;
+  std::atomic<bool> done(false);
+
+  std::thread toggle([&pool, &done] {
+    while (!done.load()) {
+      pool.workerSubscription(1).subscribeToGroup(1);
+      pool.workerSubscription(1).unSubscribeFromGroup(1);
+    }
+  });
+
+  uint32_t accepted = 0;
+  for (uint32_t a = 0; a < 10000; a++) {
+    BaseCommand<> *command = new CountCommand();
+    command->subscribeToGroup(1);
+    if (pool.addCommand(command)) {
+      accepted++;
+    } else {
+      delete command;
+    }
+  }
+
+  done = true;
+  toggle.join();
+  pool.waitUntilDone();
+
+  EXPECT_EQ(Counter::counter.load(), accepted);
+  Counter::reset();
+}
@@ -0,0 +1,325 @@
+#include "cwe_io.h"
+#include "gtest.h"
+
+using CWE::CommandPool;
+using CWE::IOBackendType;
+using CWE::IOCommand;
+using CWE::IOService;
+
+class TemporaryFile {
+ public:
+  explicit TemporaryFile(uint32_t size) : path("/tmp/cwe_io_XXXXXX") {
+    fd = mkstemp(&path[0]);
+    for (uint32_t a = 0; a < size; a++) {
+      data.push_back((char) (a % 251));
+    }
+    EXPECT_EQ(pwrite(fd, data.data(), data.size(), 0), (ssize_t) size);
+  }
+
+  ~TemporaryFile() {
+    close(fd);
+    unlink(path.c_str());
+  }
+
+  std::string path;
+  std::vector<char> data;
+  int fd;
+};
+
+struct Results {
+  static void reset() {
+    completed = 0;
+    bytes = 0;
+    mismatches = 0;
+  }
+  static std::atomic<unsigned int> completed;
+  static std::atomic<unsigned int> bytes;
+  static std::atomic<unsigned int> mismatches;
+};
+
+std::atomic<unsigned int> Results::completed(0);
+std::atomic<unsigned int> Results::bytes(0);
+std::atomic<unsigned int> Results::mismatches(0);
+
+class ReadCommand : public IOCommand<ReadCommand> {
+ public:
+  ReadCommand(IOService<> *io, TemporaryFile *file) : io(io), file(file) {}
+
+ protected:
+  void execute() {
+    EXPECT_EQ(request.owner, nullptr);
+
+    if (request.result > 0) {
+      Results::bytes += request.result;
+      if (file != nullptr
+          && memcmp(request.buffer, file->data.data() + request.offset, (size_t) request.result) != 0) {
+        Results::mismatches++;
+      }
+    }
+
+    if (request.bufferIndex >= 0) {
+      io->releaseBuffer(request.bufferIndex);
+    }
+    Results::completed++;
+  }
+
+  IOService<> *io;
+  TemporaryFile *file;
+};
+
+// Reads a file block by block, each completion submitting the next read.
+class StreamCommand : public IOCommand<StreamCommand> {
+ public:
+  StreamCommand(IOService<> *io, TemporaryFile *file, uint32_t block, bool continuation = false)
+      : io(io), file(file), block(block), continuation(continuation) {}
+
+ protected:
+  void execute() {
+    uint64_t offset = 0;
+
+    if (continuation) {
+      if (request.result <= 0) {
+        io->releaseBuffer(request.bufferIndex);
+        Results::completed++;
+        return;
+      }
+
+      Results::bytes += request.result;
+      if (memcmp(request.buffer, file->data.data() + request.offset, (size_t) request.result) != 0) {
+        Results::mismatches++;
+      }
+      offset = request.offset + request.result;
+    }
+
+    int32_t index = continuation ? request.bufferIndex : io->acquireBuffer();
+    EXPECT_TRUE(io->readFixed(file->fd, index, block, offset, new StreamCommand(io, file, block, true)));
+  }
+
+  IOService<> *io;
+  TemporaryFile *file;
+  uint32_t block;
+  bool continuation;
+};
+
+// The uring instances only exist where io_uring is usable, the others would silently test the thread backend.
+static std::vector<IOBackendType> backends() {
+  std::vector<IOBackendType> result;
+#ifdef CWE_HAS_IO_URING
+  if (CWE::IOUringBackend(1).isReady()) {
+    result.push_back(IOBackendType::uring);
+  }
+#endif
+  result.push_back(IOBackendType::threads);
+
+  return result;
+}
+
+class IOServiceTest : public ::testing::TestWithParam<IOBackendType> {
+ protected:
+  void SetUp() {
+    Results::reset();
+  }
+};
+
+TEST_P(IOServiceTest, backend) {
+  CommandPool<> pool;
+  IOService<> io(pool, 8, 0, 0, GetParam());
+
+  EXPECT_EQ(io.backendType(), GetParam());
+}
+
+TEST_P(IOServiceTest, read) {
+  TemporaryFile file(4096);
+  std::vector<char> buffer(file.data.size());
+
+  CommandPool<> pool;
+  IOService<> io(pool, 8, 0, 0, GetParam());
+
+  EXPECT_TRUE(io.read(file.fd, buffer.data(), 4096, 0, new ReadCommand(&io, &file)));
+  pool.waitUntilDone();
+
+  EXPECT_EQ(Results::completed.load(), 1u);
+  EXPECT_EQ(Results::bytes.load(), 4096u);
+  EXPECT_EQ(Results::mismatches.load(), 0u);
+  EXPECT_EQ(io.pending(), 0u);
+}
+
+TEST_P(IOServiceTest, read_many) {
+  const uint32_t block = 512;
+  TemporaryFile file(block * 64);
+  std::vector<char> buffer(file.data.size());
+
+  CommandPool<> pool;
+  IOService<> io(pool, 64, 0, 0, GetParam());
+
+  for (uint32_t a = 0; a < 64; a++) {
+    EXPECT_TRUE(io.read(file.fd, buffer.data() + a * block, block, a * block, new ReadCommand(&io, &file)));
+  }
+  pool.waitUntilDone();
+
+  EXPECT_EQ(Results::completed.load(), 64u);
+  EXPECT_EQ(Results::bytes.load(), block * 64);
+  EXPECT_EQ(Results::mismatches.load(), 0u);
+  EXPECT_EQ(buffer, file.data);
+}
+
+TEST_P(IOServiceTest, read_depth) {
+  TemporaryFile file(64);
+  char buffer[64];
+
+  // Without worker threads nothing reaps the completions before waitUntilDone.
+  CommandPool<1> pool;
+  IOService<> io(pool, 2, 0, 0, GetParam());
+
+  ReadCommand *rejected = new ReadCommand(&io, &file);
+  EXPECT_TRUE(io.read(file.fd, buffer, 32, 0, new ReadCommand(&io, &file)));
+  EXPECT_TRUE(io.read(file.fd, buffer + 32, 32, 32, new ReadCommand(&io, &file)));
+  EXPECT_FALSE(io.read(file.fd, buffer, 32, 0, rejected));
+  delete rejected;
+
+  pool.waitUntilDone();
+  EXPECT_EQ(Results::completed.load(), 2u);
+}
+
+TEST_P(IOServiceTest, read_not_accepted) {
+  TemporaryFile file(64);
+  char buffer[64];
+
+  CommandPool<> pool;
+  IOService<> io(pool, 8, 0, 0, GetParam());
+
+  ReadCommand *command = new ReadCommand(&io, &file);
+  command->subscribeToGroup(1);
+  EXPECT_FALSE(io.read(file.fd, buffer, 64, 0, command));
+  EXPECT_EQ(io.pending(), 0u);
+  delete command;
+
+  pool.waitUntilDone();
+  EXPECT_EQ(Results::completed.load(), 0u);
+}
+
+TEST_P(IOServiceTest, read_range) {
+  TemporaryFile file(64);
+  char buffer[64];
+
+  CommandPool<> pool;
+  IOService<> io(pool, 8, 0, 0, GetParam());
+
+  ReadCommand *command = new ReadCommand(&io, &file);
+  command->start = 0;
+  command->end = 4;
+  EXPECT_FALSE(io.read(file.fd, buffer, 64, 0, command));
+  EXPECT_EQ(io.pending(), 0u);
+  delete command;
+}
+
+TEST_P(IOServiceTest, read_destroyed) {
+  TemporaryFile file(64);
+  char buffer[64];
+
+  // Without worker threads the completion is only reaped by the destructor, which drops the continuation.
+  CommandPool<1> pool;
+  {
+    IOService<> io(pool, 8, 0, 0, GetParam());
+    EXPECT_TRUE(io.read(file.fd, buffer, 64, 0, new ReadCommand(&io, &file)));
+  }
+  pool.waitUntilDone();
+
+  EXPECT_EQ(Results::completed.load(), 0u);
+}
+
+TEST_P(IOServiceTest, two_services) {
+  TemporaryFile file(128);
+  char buffer[128];
+
+  CommandPool<> pool;
+  IOService<> first(pool, 8, 0, 0, GetParam());
+  {
+    IOService<> second(pool, 8, 0, 0, GetParam());
+
+    EXPECT_TRUE(first.read(file.fd, buffer, 64, 0, new ReadCommand(&first, &file)));
+    EXPECT_TRUE(second.read(file.fd, buffer + 64, 64, 64, new ReadCommand(&second, &file)));
+    pool.waitUntilDone();
+
+    EXPECT_EQ(Results::completed.load(), 2u);
+  }
+
+  // Destroying the second service leaves the first one registered.
+  EXPECT_TRUE(first.read(file.fd, buffer, 64, 0, new ReadCommand(&first, &file)));
+  pool.waitUntilDone();
+
+  EXPECT_EQ(Results::completed.load(), 3u);
+  EXPECT_EQ(Results::mismatches.load(), 0u);
+}
+
+TEST_P(IOServiceTest, read_error) {
+  char buffer[16];
+
+  CommandPool<> pool;
+  IOService<> io(pool, 8, 0, 0, GetParam());
+
+  ReadCommand *command = new ReadCommand(&io, nullptr);
+  EXPECT_TRUE(io.read(-1, buffer, sizeof(buffer), 0, command));
+  pool.waitUntilDone();
+
+  EXPECT_EQ(Results::completed.load(), 1u);
+  EXPECT_EQ(Results::bytes.load(), 0u);
+}
+
+TEST_P(IOServiceTest, write) {
+  TemporaryFile file(0);
+  std::string data("command worker engine");
+  char buffer[32] = {};
+
+  CommandPool<> pool;
+  IOService<> io(pool, 8, 0, 0, GetParam());
+
+  EXPECT_TRUE(io.write(file.fd, data.c_str(), (uint32_t) data.size(), 0, new ReadCommand(&io, nullptr)));
+  pool.waitUntilDone();
+
+  EXPECT_EQ(Results::completed.load(), 1u);
+  EXPECT_EQ(pread(file.fd, buffer, sizeof(buffer), 0), (ssize_t) data.size());
+  EXPECT_EQ(std::string(buffer), data);
+}
+
+TEST_P(IOServiceTest, fixed_buffers) {
+  TemporaryFile file(4096 * 4);
+
+  CommandPool<> pool;
+  IOService<> io(pool, 8, 4, 4096, GetParam());
+
+  for (uint32_t a = 0; a < 4; a++) {
+    int32_t index = io.acquireBuffer();
+    EXPECT_NE(index, -1);
+    EXPECT_TRUE(io.readFixed(file.fd, index, 4096, a * 4096, new ReadCommand(&io, &file)));
+  }
+  EXPECT_EQ(io.acquireBuffer(), -1);
+  pool.waitUntilDone();
+
+  EXPECT_EQ(Results::completed.load(), 4u);
+  EXPECT_EQ(Results::bytes.load(), 4096u * 4);
+  EXPECT_EQ(Results::mismatches.load(), 0u);
+
+  for (uint32_t a = 0; a < 4; a++) {
+    EXPECT_NE(io.acquireBuffer(), -1);
+  }
+}
+
+TEST_P(IOServiceTest, stream) {
+  const uint32_t size = 1024 * 1024 + 100;
+  TemporaryFile file(size);
+
+  CommandPool<> pool;
+  IOService<> io(pool, 8, 4, 65536, GetParam());
+
+  pool.addCommand(new StreamCommand(&io, &file, 65536));
+  pool.waitUntilDone();
+
+  EXPECT_EQ(Results::completed.load(), 1u);
+  EXPECT_EQ(Results::bytes.load(), size);
+  EXPECT_EQ(Results::mismatches.load(), 0u);
+}
+
+INSTANTIATE_TEST_CASE_P(IOService,
+                        IOServiceTest,
+                        ::testing::ValuesIn(backends()));
@@ -123,3 +123,167 @@ TEST(Subscription, accepts) {
     EXPECT_EQ(s1.accepts(s2), (const bool) testData[a][2]);
   }
 }
+
+/**
+ * Wide subscription tests
+ */
+typedef CWE::MaskSubscription<255, unsigned char> MaskSubscribe;
+
+class TestMaskSubscribe : public MaskSubscribe {
+ public:
+  using MaskSubscribe::MaskSubscription;
+
+  bool hasGroup(unsigned char group) const {
+    return (mask[group / 64].load() >> (group % 64)) & 1;
+  }
+
+  bool empty() const {
+    return mask[0].load() == 0 && mask[1].load() == 0 && mask[2].load() == 0 && mask[3].load() == 0;
+  }
+};
+
+TEST(MaskSubscription, subscribeToGroup) {
+  const unsigned char groups[] = {0, 31, 32, 63, 64, 127, 200, 254};
+
+  TestMaskSubscribe s1;
+
+  for (auto group : groups) {
+    EXPECT_FALSE(s1.hasGroup(group));
+    s1.subscribeToGroup(group);
+    EXPECT_TRUE(s1.hasGroup(group));
+  }
+
+  for (unsigned char group = 1; group < 31; group++) {
+    EXPECT_FALSE(s1.hasGroup(group));
+  }
+}
+
+TEST(MaskSubscription, unSubscribeFromGroup) {
+  const unsigned char groups[] = {0, 31, 32, 63, 64, 127, 200, 254};
+
+  TestMaskSubscribe s1;
+  for (auto group : groups) {
+    s1.subscribeToGroup(group);
+  }
+
+  for (auto group : groups) {
+    s1.unSubscribeFromGroup(group);
+    EXPECT_FALSE(s1.hasGroup(group));
+  }
+  EXPECT_TRUE(s1.empty());
+}
+
+TEST(MaskSubscription, unsubscribe) {
+  TestMaskSubscribe s1;
+  TestMaskSubscribe s2;
+  s1.subscribeToGroup(3);
+  s1.subscribeToGroup(100);
+  s1.subscribeToGroup(240);
+  s2.subscribeToGroup(100);
+  s2.subscribeToGroup(101);
+
+  s1.unSubscribe(s2);
+
+  EXPECT_TRUE(s1.hasGroup(3));
+  EXPECT_FALSE(s1.hasGroup(100));
+  EXPECT_TRUE(s1.hasGroup(240));
+  EXPECT_FALSE(s1.hasGroup(101));
+}
+
+TEST(MaskSubscription, accepts) {
+  const uint8_t testSize = 8;
+  const uint8_t testData[testSize][3] = {
+      {82, 3, false},   // 01010010 & 00000011 = false
+      {13, 67, false},  // 00001101 & 01000011 = false
+      {87, 85, true},   // 01010111 & 01010101 = true
+      {0, 0, true},     // 00000000 & 00000000 = true
+      {0, 1, false},    // 00000000 & 00000001 = false
+      {177, 23, false}, // 10110001 & 00010111 = false
+      {189, 133, true}, // 10111101 & 10000101 = true
+      {255, 255, true}, // 11111111 & 11111111 = true
+  };
+
+  for (uint8_t a = 0; a < testSize; a++) {
+    TestMaskSubscribe s1(testData[a][0]);
+    TestMaskSubscribe s2(testData[a][1]);
+
+    EXPECT_EQ(s1.accepts(s2), (const bool) testData[a][2]);
+  }
+}
+
+TEST(MaskSubscription, accepts_wide) {
+  TestMaskSubscribe worker;
+  TestMaskSubscribe command;
+  worker.subscribeToGroup(5);
+  worker.subscribeToGroup(130);
+
+  command.subscribeToGroup(130);
+  EXPECT_TRUE(worker.accepts(command));
+
+  command.subscribeToGroup(254);
+  EXPECT_FALSE(worker.accepts(command));
+
+  worker.subscribeToGroup(254);
+  EXPECT_TRUE(worker.accepts(command));
+  EXPECT_FALSE(worker.accepts(TestMaskSubscribe()));
+}
+
+TEST(MaskSubscription, concurrent) {
+  TestMaskSubscribe s1;
+  std::vector<std::thread> threads;
+
+  for (unsigned char a = 0; a < 4; a++) {
+    threads.emplace_back([&s1, a] {
+      for (unsigned char group = a; group < 252; group += 4) {
+        s1.subscribeToGroup(group);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  for (unsigned char group = 0; group < 252; group++) {
+    EXPECT_TRUE(s1.hasGroup(group));
+  }
+}
+
+TEST(Subscription, unSubscribeFromGroup_bitset) {
+  typedef Subscription<std::bitset<255>, unsigned char> BitsetSubscribe;
+
+  class TestBitsetSubscribe : public BitsetSubscribe {
+   public:
+    std::bitset<255> get() const { return mask; }
+  };
+
+  TestBitsetSubscribe s1;
+  s1.subscribeToGroup(2);
+  s1.subscribeToGroup(40);
+  s1.subscribeToGroup(200);
+
+  s1.unSubscribeFromGroup(40);
+  s1.unSubscribeFromGroup(200);
+
+  EXPECT_EQ(s1.get(), std::bitset<255>(4));
+}
+
+TEST(MaskSubscription, bitset) {
+  std::bitset<255> bits;
+  bits.set(3);
+  bits.set(64);
+  bits.set(254);
+
+  TestMaskSubscribe s1(bits);
+  EXPECT_TRUE(s1.hasGroup(3));
+  EXPECT_TRUE(s1.hasGroup(64));
+  EXPECT_TRUE(s1.hasGroup(254));
+  EXPECT_FALSE(s1.hasGroup(4));
+
+  s1.unSubscribe(std::bitset<255>().set(64));
+  EXPECT_FALSE(s1.hasGroup(64));
+
+  CWE::default_subscription s2;
+  s2.subscribe(CWE::subscription_type(5));
+  EXPECT_TRUE(s2.accepts(CWE::subscription_type(1)));
+  EXPECT_FALSE(s2.accepts(CWE::subscription_type(2)));
+}